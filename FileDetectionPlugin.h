@@ -0,0 +1,66 @@
+/****************************************************************************
+**
+** @brief FileDetection 插件接口（进程内自定义触发条件与动作）
+** 插件为 DLL，导出 C 函数 FileDetectionPluginInit，启动时由 --plugin 加载。
+** 每个插件在独立的分发线程上接收目录通知事件；事件中的文件名直接指向宿主的
+** 批次缓冲区（不以 NUL 结尾），只在回调期间有效，需要保留时自行复制。
+**
+** 每个插件有单次回调的时间预算（微秒），宿主用 QueryPerformanceCounter 计时，
+** 连续超出预算或单次调用长时间不返回的插件会被隔离（不再投递事件），
+** 插件积压时宿主丢弃其批次而不是阻塞事件接收。统计通过控制管道的 plugins 命令查看。
+**
+** 接口版本不一致时宿主拒绝加载；只在结构末尾追加字段时不改变版本号。
+**
+****************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+
+#define FILE_DETECTION_PLUGIN_ABI 1
+#define FILE_DETECTION_PLUGIN_INIT "FileDetectionPluginInit"
+
+// 插件对事件的判定
+enum FileDetectionDecision {
+    FD_DECISION_PASS = 0, // 不处理
+    FD_DECISION_FIRE = 1  // 视为检测命中：调用插件的 onDetected，未提供时终止写入者
+};
+
+// 插件可向宿主提交的动作，在宿主的动作线程上依次执行
+enum FileDetectionActionType {
+    FD_ACTION_KILL_WRITERS = 1, // 按宿主配置终止写文件程序（持有者索引或进程名）
+    FD_ACTION_KILL_PROCESS = 2, // 按进程名终止，text 为进程名
+    FD_ACTION_TERMINATE_PID = 3, // 终止指定 pid
+    FD_ACTION_LOG = 4           // 输出一行日志，text 为内容
+};
+
+// 零拷贝事件视图
+struct FileDetectionEvent {
+    DWORD action;           // FILE_ACTION_*
+    const WCHAR* fileName;  // 相对被监控目录的文件名，不以 NUL 结尾
+    DWORD fileNameLength;   // 字符数
+    LONGLONG timeUs;        // 宿主收到该批次的时间（QueryPerformanceCounter 换算的微秒）
+};
+
+// 宿主提供给插件的接口，在插件卸载前一直有效
+struct FileDetectionHost {
+    DWORD abiVersion;
+    const WCHAR* directory;  // 被监控目录
+    const WCHAR* targetFile; // 内置触发器的目标文件名
+    void* context;
+    // 线程安全，可在任意回调中调用；text 在调用返回后即可释放
+    void (*enqueueAction)(void* context, DWORD type, DWORD processId, const WCHAR* text);
+};
+
+// 插件在初始化时填写的描述
+struct FileDetectionPlugin {
+    DWORD abiVersion;   // 必须为 FILE_DETECTION_PLUGIN_ABI
+    const char* name;
+    DWORD budgetUs;     // 单次回调预算，0 表示使用宿主的 --plugin-budget
+    void* state;        // 原样传回各回调
+    DWORD (*onEvent)(void* state, const FileDetectionEvent* event); // 返回 FileDetectionDecision
+    void (*onDetected)(void* state, const FileDetectionEvent* event); // 可选：自定义终止流程
+    void (*shutdown)(void* state); // 可选
+};
+
+typedef BOOL (*FileDetectionPluginInitFunc)(const FileDetectionHost* host, FileDetectionPlugin* plugin);
@@ -0,0 +1,98 @@
+/****************************************************************************
+**
+** @brief FileDetection 与注入库（FileDetectionShim.dll）共享的控制块
+** 监控端在写文件程序挂起时创建命名共享内存 Local\FileDetectionShim-<pid>，
+** 注入库加载后按自身 pid 打开同一块内存，读取故障注入计划与录制设置。
+**
+** 录制文件（UTF-8 文本，每行一个操作，字段以制表符分隔，空字段为 "-"）：
+**     op  path  path2  offset  length  caller  time
+** op 取值：exist（录制开始前已存在，由监控端写入）、create、mkdir、truncate、
+** write、fsync、dirsync、rename、unlink、rmdir。路径相对于被监控目录，
+** caller 为调用方模块名+偏移（例如 TxrUi.exe+0x1a2b），time 为 QueryPerformanceCounter
+** 换算的微秒时间戳，与监控端时基一致（时间膨胀时为写文件程序看到的时间）。
+**
+** 时间膨胀：timeScale 大于 1 时，写文件程序看到的时钟从起点起按 timeScale 倍速前进：
+**     virtual = origin + (real - origin) * timeScale
+** QueryPerformanceCounter、GetTickCount(64)、GetSystemTime(Precise)AsFileTime 按此换算，
+** Sleep、各类等待超时与定时器的时长按 timeScale 缩短。监控端用同一组起点把自己的
+** 时间戳换算到写文件程序的时钟上。
+**
+** 输入录制与回放：录制时把写文件程序的外部输入按调用顺序写入 inputFile，
+** 回放时不再访问真实来源，而是按录制依次返回，使多次运行产生相同的输出。
+** 文件为若干条 ShimInputRecord 记录头，每条后接 length 字节数据；回放按
+** （kind, channel）分成多条流，流内按顺序取用。录制用完后 inputMisses 计数，
+** 读取按输入结束处理，时钟从最后一个录制值起按真实流逝继续。
+**
+****************************************************************************/
+
+#pragma once
+
+#include <windows.h>
+#include <cwchar>
+
+#define FILE_DETECTION_SHIM_VERSION 4
+
+// 注入目标操作
+enum ShimOperation {
+    SHIM_OP_WRITE = 1, // WriteFile
+    SHIM_OP_FLUSH = 2  // FlushFileBuffers
+};
+
+enum ShimInputMode {
+    SHIM_INPUT_OFF = 0,
+    SHIM_INPUT_CAPTURE = 1,
+    SHIM_INPUT_REPLAY = 2
+};
+
+// 输入记录类型；value 为调用的返回值，error 为返回后的 GetLastError
+enum ShimInputKind {
+    SHIM_INPUT_READ = 1,    // 管道、控制台等非磁盘句柄上的同步 ReadFile，数据为读到的内容；channel 0 为标准输入
+    SHIM_INPUT_CONNECT = 2, // connect，channel 为目标地址的哈希（同一连接上的 recv/send 沿用）
+    SHIM_INPUT_RECV = 3,    // recv，数据为收到的内容
+    SHIM_INPUT_SEND = 4,    // send，只记返回值；回放时不发送
+    SHIM_INPUT_CLOCK = 5,   // 时钟读数（value），channel 取 ShimClockChannel
+    SHIM_INPUT_RANDOM = 6   // BCryptGenRandom、RtlGenRandom、CryptGenRandom，数据为生成的字节
+};
+
+enum ShimClockChannel {
+    SHIM_CLOCK_COUNTER = 0,  // QueryPerformanceCounter
+    SHIM_CLOCK_TICK = 1,     // GetTickCount(64)
+    SHIM_CLOCK_FILETIME = 2, // GetSystemTime(Precise)AsFileTime
+    SHIM_CLOCK_CHANNELS = 3
+};
+
+struct ShimInputRecord {
+    DWORD kind;      // ShimInputKind
+    DWORD channel;
+    LONGLONG value;
+    DWORD error;
+    DWORD length;    // 随后的数据字节数
+};
+
+struct ShimControlBlock {
+    LONG version;                // FILE_DETECTION_SHIM_VERSION
+    volatile LONG attached;      // 注入库完成导入表修改后置 1
+    volatile LONG armed;         // 0 时所有钩子直接透传
+    LONG operation;              // ShimOperation
+    DWORD errorCode;             // 失败时 SetLastError 的值
+    DWORD shortBytes;            // 非零表示短写：只写入该字节数并返回成功
+    volatile LONG remaining;     // 剩余注入次数，-1 表示持续注入
+    volatile LONG injected;      // 已注入次数
+    WCHAR targetFile[MAX_PATH];  // 目标文件名（不含路径，不区分大小写）
+    LONG recording;              // 非零时把被监控目录内的文件操作追加到 traceFile
+    WCHAR traceFile[MAX_PATH];
+    WCHAR watchedPath[MAX_PATH];      // 被监控目录的完整路径（GetFullPathNameW 形式）
+    WCHAR watchedFinalPath[MAX_PATH]; // 同一目录的最终路径（GetFinalPathNameByHandleW 形式，不含 \\?\ 前缀）
+    LONG timeScale;                   // 大于 1 时开启时间膨胀
+    LONGLONG timeOriginCounter;       // 膨胀起点：QueryPerformanceCounter 计数
+    LONGLONG timeOriginFileTime;      // 同一时刻的系统时间（FILETIME，100ns）
+    ULONGLONG timeOriginTick;         // 同一时刻的 GetTickCount64
+    LONG inputMode;                   // ShimInputMode
+    WCHAR inputFile[MAX_PATH];        // 输入录制文件
+    volatile LONG inputRecords;       // 已录制 / 已回放的记录数
+    volatile LONG inputMisses;        // 回放时录制中已没有对应记录的调用数（运行偏离了录制）
+};
+
+inline void FormatShimControlName(DWORD processId, WCHAR* name, size_t capacity) {
+    swprintf(name, capacity, L"Local\\FileDetectionShim-%lu", processId);
+}
@@ -0,0 +1,1011 @@
+/****************************************************************************
+**
+** @brief FileDetection 注入库（FileDetectionShim.dll）
+** 由 FileDetection 在写文件程序挂起时通过 CreateRemoteThread + LoadLibraryW 注入，
+** 再以第二个远程线程调用导出函数 FileDetectionShimAttach（避免在加载器锁内遍历模块），
+** 修改进程内各模块导入表中的 WriteFile / FlushFileBuffers，按控制块中的计划
+** 让目标文件上的写入或刷盘失败（指定错误码）或只写入一部分（短写）。
+**
+** 录制模式下还拦截 CreateFileW、MoveFileW/MoveFileExW、DeleteFileW、
+** CreateDirectoryW、RemoveDirectoryW，把被监控目录内的命名空间操作、数据写入、
+** 文件与目录刷盘按调用顺序追加到录制文件（格式见 FileDetectionShim.h）。
+** ReplaceFileW、SetFileInformationByHandle 等其他改名/删除途径不在录制范围内。
+**
+** 时间膨胀模式下另外拦截时钟（QueryPerformanceCounter、GetTickCount/GetTickCount64、
+** GetSystemTimeAsFileTime/GetSystemTimePreciseAsFileTime）、Sleep/SleepEx、
+** WaitForSingleObject(Ex)/WaitForMultipleObjects(Ex)/MsgWaitForMultipleObjects(Ex) 的超时，
+** 以及 SetTimer、SetWaitableTimer、CreateTimerQueueTimer、SetThreadpoolTimer 的定时，
+** 让按定时器刷盘的写文件程序在不修改的情况下加速运行。未经这些接口的计时
+** （例如直接读取 KUSER_SHARED_DATA、rdtsc）不受影响。
+**
+** 输入录制/回放模式下拦截外部输入：管道与控制台上的同步 ReadFile（含标准输入）、
+** connect/recv/send、上述时钟，以及 BCryptGenRandom、RtlGenRandom（SystemFunction036）、
+** CryptGenRandom。按序号导入 ws2_32 的模块、重叠 I/O、WSARecv 与 select 不在拦截范围内，
+** 回放只适用于阻塞套接字。
+**
+** 未布防时钩子只读取一次共享内存中的 armed 标志便直接调用原函数，
+** 非目标文件的 I/O 基本保持原生速度。
+**
+** 注意：只修改注入时已加载模块的导入表；注入库须与写文件程序位数一致。
+**
+****************************************************************************/
+
+#include "FileDetectionShim.h"
+#include <tlhelp32.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHIM_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define SHIM_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+namespace {
+
+HMODULE g_self = nullptr;
+ShimControlBlock* g_control = nullptr;
+HANDLE g_mapping = nullptr;
+
+typedef BOOL (WINAPI *WriteFileFunc)(HANDLE, LPCVOID, DWORD, LPDWORD, LPOVERLAPPED);
+typedef BOOL (WINAPI *FlushFileBuffersFunc)(HANDLE);
+typedef HANDLE (WINAPI *CreateFileWFunc)(LPCWSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+typedef BOOL (WINAPI *MoveFileExWFunc)(LPCWSTR, LPCWSTR, DWORD);
+typedef BOOL (WINAPI *MoveFileWFunc)(LPCWSTR, LPCWSTR);
+typedef BOOL (WINAPI *DeleteFileWFunc)(LPCWSTR);
+typedef BOOL (WINAPI *CreateDirectoryWFunc)(LPCWSTR, LPSECURITY_ATTRIBUTES);
+typedef BOOL (WINAPI *RemoveDirectoryWFunc)(LPCWSTR);
+typedef BOOL (WINAPI *QueryPerformanceCounterFunc)(LARGE_INTEGER*);
+typedef ULONGLONG (WINAPI *GetTickCount64Func)();
+typedef VOID (WINAPI *GetSystemTimeAsFileTimeFunc)(LPFILETIME);
+typedef VOID (WINAPI *SleepFunc)(DWORD);
+typedef DWORD (WINAPI *SleepExFunc)(DWORD, BOOL);
+typedef DWORD (WINAPI *WaitForSingleObjectExFunc)(HANDLE, DWORD, BOOL);
+typedef DWORD (WINAPI *WaitForMultipleObjectsExFunc)(DWORD, const HANDLE*, BOOL, DWORD, BOOL);
+typedef DWORD (WINAPI *MsgWaitForMultipleObjectsExFunc)(DWORD, const HANDLE*, DWORD, DWORD, DWORD);
+typedef UINT_PTR (WINAPI *SetTimerFunc)(HWND, UINT_PTR, UINT, TIMERPROC);
+typedef BOOL (WINAPI *SetWaitableTimerFunc)(HANDLE, const LARGE_INTEGER*, LONG, PTIMERAPCROUTINE, LPVOID, BOOL);
+typedef BOOL (WINAPI *CreateTimerQueueTimerFunc)(PHANDLE, HANDLE, WAITORTIMERCALLBACK, PVOID, DWORD, DWORD, ULONG);
+typedef VOID (WINAPI *SetThreadpoolTimerFunc)(PTP_TIMER, PFILETIME, DWORD, DWORD);
+typedef BOOL (WINAPI *ReadFileFunc)(HANDLE, LPVOID, DWORD, LPDWORD, LPOVERLAPPED);
+typedef int (WINAPI *ConnectFunc)(UINT_PTR, const void*, int); // 套接字句柄按 UINT_PTR 传递，不引入 winsock2.h
+typedef int (WINAPI *RecvFunc)(UINT_PTR, char*, int, int);
+typedef int (WINAPI *SendFunc)(UINT_PTR, const char*, int, int);
+typedef LONG (WINAPI *BCryptGenRandomFunc)(PVOID, PUCHAR, ULONG, ULONG);
+typedef BOOLEAN (WINAPI *RtlGenRandomFunc)(PVOID, ULONG);
+typedef BOOL (WINAPI *CryptGenRandomFunc)(ULONG_PTR, DWORD, BYTE*);
+
+WriteFileFunc g_originalWriteFile = nullptr;
+FlushFileBuffersFunc g_originalFlushFileBuffers = nullptr;
+CreateFileWFunc g_originalCreateFileW = nullptr;
+MoveFileExWFunc g_originalMoveFileExW = nullptr;
+MoveFileWFunc g_originalMoveFileW = nullptr;
+DeleteFileWFunc g_originalDeleteFileW = nullptr;
+CreateDirectoryWFunc g_originalCreateDirectoryW = nullptr;
+RemoveDirectoryWFunc g_originalRemoveDirectoryW = nullptr;
+QueryPerformanceCounterFunc g_originalQueryPerformanceCounter = nullptr;
+GetTickCount64Func g_originalGetTickCount64 = nullptr;
+GetSystemTimeAsFileTimeFunc g_originalGetSystemTimeAsFileTime = nullptr;
+GetSystemTimeAsFileTimeFunc g_originalGetSystemTimePreciseAsFileTime = nullptr;
+SleepFunc g_originalSleep = nullptr;
+SleepExFunc g_originalSleepEx = nullptr;
+WaitForSingleObjectExFunc g_originalWaitForSingleObjectEx = nullptr;
+WaitForMultipleObjectsExFunc g_originalWaitForMultipleObjectsEx = nullptr;
+MsgWaitForMultipleObjectsExFunc g_originalMsgWaitForMultipleObjectsEx = nullptr;
+SetTimerFunc g_originalSetTimer = nullptr;
+SetWaitableTimerFunc g_originalSetWaitableTimer = nullptr;
+CreateTimerQueueTimerFunc g_originalCreateTimerQueueTimer = nullptr;
+SetThreadpoolTimerFunc g_originalSetThreadpoolTimer = nullptr;
+ReadFileFunc g_originalReadFile = nullptr;
+ConnectFunc g_originalConnect = nullptr;
+RecvFunc g_originalRecv = nullptr;
+SendFunc g_originalSend = nullptr;
+BCryptGenRandomFunc g_originalBCryptGenRandom = nullptr;
+RtlGenRandomFunc g_originalRtlGenRandom = nullptr;
+CryptGenRandomFunc g_originalCryptGenRandom = nullptr;
+
+// 录制文件，写入时持锁保证各线程的操作按调用顺序落盘
+CRITICAL_SECTION g_traceLock;
+HANDLE g_trace = INVALID_HANDLE_VALUE;
+
+bool IsRecording() {
+    return g_control != nullptr && g_control->recording != 0 && g_trace != INVALID_HANDLE_VALUE;
+}
+
+// path 位于 directory 内时输出相对路径
+bool StripDirectory(const WCHAR* path, const WCHAR* directory, std::wstring& relative) {
+    size_t length = wcslen(directory);
+    if (length == 0 || wcslen(path) <= length ||
+        CompareStringOrdinal(path, static_cast<int>(length), directory, static_cast<int>(length), TRUE) != CSTR_EQUAL) {
+        return false;
+    }
+
+    const WCHAR* rest = path + length;
+    if (*rest == L'\\' || *rest == L'/') {
+        ++rest;
+    } else if (directory[length - 1] != L'\\') {
+        return false; // 只是名称前缀相同的兄弟目录
+    }
+    relative = rest;
+    return !relative.empty();
+}
+
+// 按文件名参数判断是否位于被监控目录
+bool RelativeFromName(LPCWSTR name, std::wstring& relative) {
+    if (name == nullptr) {
+        return false;
+    }
+    WCHAR full[MAX_PATH * 2];
+    DWORD length = GetFullPathNameW(name, MAX_PATH * 2, full, nullptr);
+    if (length == 0 || length >= MAX_PATH * 2) {
+        return false;
+    }
+    return StripDirectory(full, g_control->watchedPath, relative) ||
+           StripDirectory(full, g_control->watchedFinalPath, relative);
+}
+
+// 按句柄判断是否位于被监控目录（管道、控制台等句柄返回 false）
+bool RelativeFromHandle(HANDLE hFile, std::wstring& relative) {
+    WCHAR path[MAX_PATH * 2];
+    DWORD length = GetFinalPathNameByHandleW(hFile, path, MAX_PATH * 2, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    if (length == 0 || length >= MAX_PATH * 2) {
+        return false;
+    }
+    const WCHAR* start = wcsncmp(path, L"\\\\?\\", 4) == 0 ? path + 4 : path;
+    return StripDirectory(start, g_control->watchedFinalPath, relative) ||
+           StripDirectory(start, g_control->watchedPath, relative);
+}
+
+/****************************************************************************
+** 输入录制与回放（文件格式见 FileDetectionShim.h）
+** 录制每次调用后追加一条记录（不缓冲，写文件程序被终止时已有的记录不丢失）；
+** 回放在 Attach 时一次读入全部记录，按（kind, channel）分流。
+****************************************************************************/
+
+struct ReplayRecord {
+    ShimInputRecord header;
+    std::string data;
+};
+
+struct ReplayStream {
+    std::vector<ReplayRecord> records;
+    size_t next;
+};
+
+CRITICAL_SECTION g_inputLock;
+HANDLE g_inputLog = INVALID_HANDLE_VALUE;             // 录制时
+std::map<ULONGLONG, ReplayStream>* g_replay = nullptr; // 回放时
+std::map<UINT_PTR, DWORD> g_socketChannels;            // 已连接套接字 → channel
+volatile LONGLONG g_clockOffset[SHIM_CLOCK_CHANNELS];  // 回放时录制值与真实读数之差
+
+bool IsCapturingInputs() {
+    return g_control != nullptr && g_control->inputMode == SHIM_INPUT_CAPTURE && g_inputLog != INVALID_HANDLE_VALUE;
+}
+
+bool IsReplayingInputs() {
+    return g_control != nullptr && g_control->inputMode == SHIM_INPUT_REPLAY && g_replay != nullptr;
+}
+
+ULONGLONG StreamKey(DWORD kind, DWORD channel) {
+    return (static_cast<ULONGLONG>(kind) << 32) | channel;
+}
+
+// 追加一条录制记录；保留调用方看到的 LastError
+void CaptureInput(DWORD kind, DWORD channel, LONGLONG value, DWORD error, const void* data, DWORD length) {
+    ShimInputRecord record = { kind, channel, value, error, length };
+    DWORD lastError = GetLastError();
+    EnterCriticalSection(&g_inputLock);
+    DWORD written = 0;
+    g_originalWriteFile(g_inputLog, &record, sizeof(record), &written, nullptr);
+    if (length > 0) {
+        g_originalWriteFile(g_inputLog, data, length, &written, nullptr);
+    }
+    LeaveCriticalSection(&g_inputLock);
+    InterlockedIncrement(&g_control->inputRecords);
+    SetLastError(lastError);
+}
+
+// 取出 (kind, channel) 流的下一条记录；录制已用完时返回 false
+bool ReplayInput(DWORD kind, DWORD channel, ShimInputRecord& record, std::string* data) {
+    EnterCriticalSection(&g_inputLock);
+    auto found = g_replay->find(StreamKey(kind, channel));
+    bool available = found != g_replay->end() && found->second.next < found->second.records.size();
+    if (available) {
+        const ReplayRecord& next = found->second.records[found->second.next++];
+        record = next.header;
+        if (data != nullptr) {
+            *data = next.data;
+        }
+    }
+    LeaveCriticalSection(&g_inputLock);
+    InterlockedIncrement(available ? &g_control->inputRecords : &g_control->inputMisses);
+    return available;
+}
+
+bool LoadInputLog(const WCHAR* path) {
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    std::string content;
+    char chunk[65536];
+    DWORD bytes = 0;
+    while (ReadFile(hFile, chunk, sizeof(chunk), &bytes, nullptr) && bytes > 0) {
+        content.append(chunk, bytes);
+    }
+    CloseHandle(hFile);
+
+    g_replay = new std::map<ULONGLONG, ReplayStream>();
+    for (size_t offset = 0; offset + sizeof(ShimInputRecord) <= content.size();) {
+        ReplayRecord record;
+        memcpy(&record.header, content.data() + offset, sizeof(ShimInputRecord));
+        offset += sizeof(ShimInputRecord);
+        if (record.header.length > content.size() - offset) {
+            break; // 录制时被终止，最后一条不完整
+        }
+        record.data.assign(content.data() + offset, record.header.length);
+        offset += record.header.length;
+        (*g_replay)[StreamKey(record.header.kind, record.header.channel)].records.push_back(record);
+    }
+    return true;
+}
+
+// 时钟读数：回放时返回录制值，录制用完后沿最后一个录制值按真实流逝继续
+LONGLONG InputClock(DWORD channel, LONGLONG real) {
+    if (IsReplayingInputs()) {
+        ShimInputRecord record;
+        if (ReplayInput(SHIM_INPUT_CLOCK, channel, record, nullptr)) {
+            g_clockOffset[channel] = record.value - real;
+            return record.value;
+        }
+        return real + g_clockOffset[channel];
+    }
+    if (IsCapturingInputs()) {
+        CaptureInput(SHIM_INPUT_CLOCK, channel, real, 0, nullptr, 0);
+    }
+    return real;
+}
+
+// 管道、控制台等外部输入；磁盘文件与重叠读取不在范围内
+bool IsExternalInput(HANDLE hFile, LPOVERLAPPED lpOverlapped) {
+    if (lpOverlapped != nullptr) {
+        return false;
+    }
+    DWORD error = GetLastError();
+    DWORD type = GetFileType(hFile);
+    SetLastError(error);
+    return type == FILE_TYPE_PIPE || type == FILE_TYPE_CHAR;
+}
+
+BOOL WINAPI HookReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead,
+                         LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped) {
+    bool replay = IsReplayingInputs();
+    if ((!replay && !IsCapturingInputs()) || !IsExternalInput(hFile, lpOverlapped)) {
+        return g_originalReadFile(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+    }
+
+    DWORD channel = hFile == GetStdHandle(STD_INPUT_HANDLE) ? 0 : 1;
+    DWORD bytes = 0;
+    if (replay) {
+        ShimInputRecord record;
+        std::string data;
+        if (!ReplayInput(SHIM_INPUT_READ, channel, record, &data)) {
+            record.value = FALSE; // 录制已用完：按管道已关闭处理
+            record.error = ERROR_BROKEN_PIPE;
+        }
+        bytes = static_cast<DWORD>(std::min<size_t>(data.size(), nNumberOfBytesToRead));
+        memcpy(lpBuffer, data.data(), bytes);
+        if (lpNumberOfBytesRead != nullptr) {
+            *lpNumberOfBytesRead = bytes;
+        }
+        SetLastError(record.error);
+        return record.value != 0 ? TRUE : FALSE;
+    }
+
+    BOOL ok = g_originalReadFile(hFile, lpBuffer, nNumberOfBytesToRead, &bytes, nullptr);
+    if (lpNumberOfBytesRead != nullptr) {
+        *lpNumberOfBytesRead = bytes;
+    }
+    CaptureInput(SHIM_INPUT_READ, channel, ok, GetLastError(), lpBuffer, ok ? bytes : 0);
+    return ok;
+}
+
+DWORD SocketChannel(UINT_PTR socket) {
+    EnterCriticalSection(&g_inputLock);
+    auto found = g_socketChannels.find(socket);
+    DWORD channel = found != g_socketChannels.end() ? found->second : 0;
+    LeaveCriticalSection(&g_inputLock);
+    return channel;
+}
+
+// 连接的 channel 取目标地址（sockaddr 原始字节）的 FNV-1a 哈希，与套接字句柄值无关
+int WINAPI HookConnect(UINT_PTR socket, const void* address, int addressLength) {
+    DWORD channel = 2166136261u;
+    for (int i = 0; i < addressLength; ++i) {
+        channel = (channel ^ static_cast<const BYTE*>(address)[i]) * 16777619u;
+    }
+    EnterCriticalSection(&g_inputLock);
+    g_socketChannels[socket] = channel;
+    LeaveCriticalSection(&g_inputLock);
+
+    if (IsReplayingInputs()) {
+        ShimInputRecord record;
+        if (!ReplayInput(SHIM_INPUT_CONNECT, channel, record, nullptr)) {
+            record.value = -1; // SOCKET_ERROR
+            record.error = 10061; // WSAECONNREFUSED
+        }
+        SetLastError(record.error);
+        return static_cast<int>(record.value);
+    }
+    int result = g_originalConnect(socket, address, addressLength);
+    if (IsCapturingInputs()) {
+        CaptureInput(SHIM_INPUT_CONNECT, channel, result, GetLastError(), nullptr, 0);
+    }
+    return result;
+}
+
+int WINAPI HookRecv(UINT_PTR socket, char* buffer, int length, int flags) {
+    if (IsReplayingInputs()) {
+        ShimInputRecord record;
+        std::string data;
+        if (!ReplayInput(SHIM_INPUT_RECV, SocketChannel(socket), record, &data)) {
+            record.value = 0; // 录制已用完：按对端关闭处理
+            record.error = ERROR_SUCCESS;
+        }
+        memcpy(buffer, data.data(), std::min<size_t>(data.size(), static_cast<size_t>(std::max(length, 0))));
+        SetLastError(record.error);
+        return static_cast<int>(record.value);
+    }
+    int result = g_originalRecv(socket, buffer, length, flags);
+    if (IsCapturingInputs()) {
+        CaptureInput(SHIM_INPUT_RECV, SocketChannel(socket), result, GetLastError(), buffer,
+                     result > 0 ? static_cast<DWORD>(result) : 0);
+    }
+    return result;
+}
+
+int WINAPI HookSend(UINT_PTR socket, const char* buffer, int length, int flags) {
+    if (IsReplayingInputs()) {
+        ShimInputRecord record;
+        if (!ReplayInput(SHIM_INPUT_SEND, SocketChannel(socket), record, nullptr)) {
+            record.value = length;
+            record.error = ERROR_SUCCESS;
+        }
+        SetLastError(record.error);
+        return static_cast<int>(record.value);
+    }
+    int result = g_originalSend(socket, buffer, length, flags);
+    if (IsCapturingInputs()) {
+        CaptureInput(SHIM_INPUT_SEND, SocketChannel(socket), result, GetLastError(), nullptr, 0);
+    }
+    return result;
+}
+
+// 随机数：回放时返回录制的字节，录制用完后改用真实随机数
+template <typename Generate>
+LONGLONG InputRandom(void* buffer, ULONG length, Generate generate) {
+    ShimInputRecord record;
+    std::string data;
+    if (IsReplayingInputs() && ReplayInput(SHIM_INPUT_RANDOM, 0, record, &data)) {
+        memcpy(buffer, data.data(), std::min<size_t>(data.size(), length));
+        SetLastError(record.error);
+        return record.value;
+    }
+    LONGLONG value = generate();
+    if (IsCapturingInputs()) {
+        CaptureInput(SHIM_INPUT_RANDOM, 0, value, GetLastError(), buffer, length);
+    }
+    return value;
+}
+
+LONG WINAPI HookBCryptGenRandom(PVOID algorithm, PUCHAR buffer, ULONG length, ULONG flags) {
+    return static_cast<LONG>(InputRandom(buffer, length, [&] {
+        return static_cast<LONGLONG>(g_originalBCryptGenRandom(algorithm, buffer, length, flags));
+    }));
+}
+
+BOOLEAN WINAPI HookRtlGenRandom(PVOID buffer, ULONG length) {
+    return static_cast<BOOLEAN>(InputRandom(buffer, length, [&] {
+        return static_cast<LONGLONG>(g_originalRtlGenRandom(buffer, length));
+    }));
+}
+
+BOOL WINAPI HookCryptGenRandom(ULONG_PTR provider, DWORD length, BYTE* buffer) {
+    return static_cast<BOOL>(InputRandom(buffer, length, [&] {
+        return static_cast<LONGLONG>(g_originalCryptGenRandom(provider, length, buffer));
+    }));
+}
+
+/****************************************************************************
+** 时间膨胀（换算公式见 FileDetectionShim.h）
+****************************************************************************/
+
+bool IsDilated() {
+    return g_control != nullptr && g_control->timeScale > 1;
+}
+
+// 起点之前的时刻保持不变（例如写文件程序启动前记录的时间）
+LONGLONG Dilate(LONGLONG real, LONGLONG origin) {
+    return real <= origin ? real : origin + (real - origin) * g_control->timeScale;
+}
+
+// 写文件程序请求的时长（毫秒）换算为真实时长；0 与 INFINITE 保持不变，非零时长至少 1ms
+DWORD ContractMilliseconds(DWORD milliseconds) {
+    if (!IsDilated() || milliseconds == 0 || milliseconds == INFINITE) {
+        return milliseconds;
+    }
+    DWORD contracted = milliseconds / static_cast<DWORD>(g_control->timeScale);
+    return contracted == 0 ? 1 : contracted;
+}
+
+// FILETIME 形式的到期时间：负数为相对时长（100ns），正数为写文件程序时钟上的绝对时间
+LONGLONG ContractDueTime(LONGLONG due) {
+    if (!IsDilated()) {
+        return due;
+    }
+    if (due < 0) {
+        LONGLONG contracted = due / g_control->timeScale;
+        return contracted == 0 ? -1 : contracted;
+    }
+    LONGLONG origin = g_control->timeOriginFileTime;
+    return due <= origin ? due : origin + (due - origin) / g_control->timeScale;
+}
+
+BOOL WINAPI HookQueryPerformanceCounter(LARGE_INTEGER* counter) {
+    BOOL ok = g_originalQueryPerformanceCounter(counter);
+    if (ok && IsDilated()) {
+        counter->QuadPart = Dilate(counter->QuadPart, g_control->timeOriginCounter);
+    }
+    if (ok) {
+        counter->QuadPart = InputClock(SHIM_CLOCK_COUNTER, counter->QuadPart);
+    }
+    return ok;
+}
+
+ULONGLONG WINAPI HookGetTickCount64() {
+    LONGLONG tick = static_cast<LONGLONG>(g_originalGetTickCount64());
+    if (IsDilated()) {
+        tick = Dilate(tick, static_cast<LONGLONG>(g_control->timeOriginTick));
+    }
+    return static_cast<ULONGLONG>(InputClock(SHIM_CLOCK_TICK, tick));
+}
+
+DWORD WINAPI HookGetTickCount() {
+    return static_cast<DWORD>(HookGetTickCount64());
+}
+
+// 时间膨胀与输入录制/回放
+void AdjustFileTime(LPFILETIME fileTime) {
+    ULARGE_INTEGER value;
+    value.LowPart = fileTime->dwLowDateTime;
+    value.HighPart = fileTime->dwHighDateTime;
+    LONGLONG time = static_cast<LONGLONG>(value.QuadPart);
+    if (IsDilated()) {
+        time = Dilate(time, g_control->timeOriginFileTime);
+    }
+    value.QuadPart = static_cast<ULONGLONG>(InputClock(SHIM_CLOCK_FILETIME, time));
+    fileTime->dwLowDateTime = value.LowPart;
+    fileTime->dwHighDateTime = value.HighPart;
+}
+
+VOID WINAPI HookGetSystemTimeAsFileTime(LPFILETIME fileTime) {
+    g_originalGetSystemTimeAsFileTime(fileTime);
+    AdjustFileTime(fileTime);
+}
+
+VOID WINAPI HookGetSystemTimePreciseAsFileTime(LPFILETIME fileTime) {
+    g_originalGetSystemTimePreciseAsFileTime(fileTime);
+    AdjustFileTime(fileTime);
+}
+
+VOID WINAPI HookSleep(DWORD milliseconds) {
+    g_originalSleep(ContractMilliseconds(milliseconds));
+}
+
+DWORD WINAPI HookSleepEx(DWORD milliseconds, BOOL alertable) {
+    return g_originalSleepEx(ContractMilliseconds(milliseconds), alertable);
+}
+
+DWORD WINAPI HookWaitForSingleObject(HANDLE handle, DWORD milliseconds) {
+    return g_originalWaitForSingleObjectEx(handle, ContractMilliseconds(milliseconds), FALSE);
+}
+
+DWORD WINAPI HookWaitForSingleObjectEx(HANDLE handle, DWORD milliseconds, BOOL alertable) {
+    return g_originalWaitForSingleObjectEx(handle, ContractMilliseconds(milliseconds), alertable);
+}
+
+DWORD WINAPI HookWaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds) {
+    return g_originalWaitForMultipleObjectsEx(count, handles, waitAll, ContractMilliseconds(milliseconds), FALSE);
+}
+
+DWORD WINAPI HookWaitForMultipleObjectsEx(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds, BOOL alertable) {
+    return g_originalWaitForMultipleObjectsEx(count, handles, waitAll, ContractMilliseconds(milliseconds), alertable);
+}
+
+DWORD WINAPI HookMsgWaitForMultipleObjects(DWORD count, const HANDLE* handles, BOOL waitAll, DWORD milliseconds, DWORD wakeMask) {
+    return g_originalMsgWaitForMultipleObjectsEx(count, handles, ContractMilliseconds(milliseconds), wakeMask,
+                                                 waitAll ? MWMO_WAITALL : 0);
+}
+
+DWORD WINAPI HookMsgWaitForMultipleObjectsEx(DWORD count, const HANDLE* handles, DWORD milliseconds, DWORD wakeMask, DWORD flags) {
+    return g_originalMsgWaitForMultipleObjectsEx(count, handles, ContractMilliseconds(milliseconds), wakeMask, flags);
+}
+
+UINT_PTR WINAPI HookSetTimer(HWND window, UINT_PTR id, UINT elapse, TIMERPROC callback) {
+    return g_originalSetTimer(window, id, ContractMilliseconds(elapse), callback);
+}
+
+BOOL WINAPI HookSetWaitableTimer(HANDLE timer, const LARGE_INTEGER* dueTime, LONG period, PTIMERAPCROUTINE completion,
+                                 LPVOID argument, BOOL resume) {
+    LARGE_INTEGER contracted;
+    contracted.QuadPart = ContractDueTime(dueTime->QuadPart);
+    return g_originalSetWaitableTimer(timer, &contracted, static_cast<LONG>(ContractMilliseconds(static_cast<DWORD>(period))),
+                                      completion, argument, resume);
+}
+
+BOOL WINAPI HookCreateTimerQueueTimer(PHANDLE timer, HANDLE queue, WAITORTIMERCALLBACK callback, PVOID parameter,
+                                      DWORD dueTime, DWORD period, ULONG flags) {
+    return g_originalCreateTimerQueueTimer(timer, queue, callback, parameter, ContractMilliseconds(dueTime),
+                                           ContractMilliseconds(period), flags);
+}
+
+VOID WINAPI HookSetThreadpoolTimer(PTP_TIMER timer, PFILETIME dueTime, DWORD period, DWORD window) {
+    if (dueTime == nullptr) {
+        g_originalSetThreadpoolTimer(timer, nullptr, period, window); // 取消定时器
+        return;
+    }
+    ULARGE_INTEGER value;
+    value.LowPart = dueTime->dwLowDateTime;
+    value.HighPart = dueTime->dwHighDateTime;
+    value.QuadPart = static_cast<ULONGLONG>(ContractDueTime(static_cast<LONGLONG>(value.QuadPart)));
+    FILETIME contracted = { value.LowPart, value.HighPart };
+    g_originalSetThreadpoolTimer(timer, &contracted, ContractMilliseconds(period), ContractMilliseconds(window));
+}
+
+// 与监控端 NowMicroseconds 相同的时基（QueryPerformanceCounter，微秒）；时间膨胀时为写文件程序看到的时间
+LONGLONG TraceMicroseconds() {
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    if (IsDilated()) {
+        counter.QuadPart = Dilate(counter.QuadPart, g_control->timeOriginCounter);
+    }
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+           (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+// 调用方描述：模块名+偏移
+std::wstring DescribeCaller(void* address) {
+    HMODULE module = nullptr;
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            static_cast<LPCWSTR>(address), &module)) {
+        return L"-";
+    }
+    WCHAR path[MAX_PATH];
+    DWORD length = GetModuleFileNameW(module, path, MAX_PATH);
+    const WCHAR* name = path + length;
+    while (name > path && name[-1] != L'\\') {
+        --name;
+    }
+    WCHAR offset[32];
+    swprintf(offset, 32, L"+0x%llx", static_cast<unsigned long long>(static_cast<BYTE*>(address) - reinterpret_cast<BYTE*>(module)));
+    return std::wstring(name) + offset;
+}
+
+// 追加一行录制记录；保留调用方看到的 LastError
+void AppendTrace(const WCHAR* op, const std::wstring& path, const std::wstring& path2,
+                 bool hasRange, ULONGLONG offset, ULONGLONG length, void* caller) {
+    DWORD error = GetLastError();
+    std::wstring line = op;
+    line += L"\t" + path + L"\t" + (path2.empty() ? std::wstring(L"-") : path2) + L"\t";
+    line += hasRange ? std::to_wstring(offset) + L"\t" + std::to_wstring(length) : std::wstring(L"-\t-");
+    line += L"\t" + DescribeCaller(caller) + L"\t" + std::to_wstring(TraceMicroseconds()) + L"\n";
+
+    int bytes = WideCharToMultiByte(CP_UTF8, 0, line.c_str(), static_cast<int>(line.size()), nullptr, 0, nullptr, nullptr);
+    std::string utf8(bytes, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, line.c_str(), static_cast<int>(line.size()), &utf8[0], bytes, nullptr, nullptr);
+
+    EnterCriticalSection(&g_traceLock);
+    DWORD written = 0;
+    g_originalWriteFile(g_trace, utf8.data(), static_cast<DWORD>(utf8.size()), &written, nullptr);
+    LeaveCriticalSection(&g_traceLock);
+    SetLastError(error);
+}
+
+// 句柄是否指向目标文件（仅在布防后调用，比较路径的最后一段）
+bool IsTargetHandle(HANDLE hFile) {
+    WCHAR path[MAX_PATH * 2];
+    DWORD length = GetFinalPathNameByHandleW(hFile, path, MAX_PATH * 2, FILE_NAME_NORMALIZED);
+    if (length == 0 || length >= MAX_PATH * 2) {
+        return false;
+    }
+
+    const WCHAR* name = path + length;
+    while (name > path && name[-1] != L'\\' && name[-1] != L'/') {
+        --name;
+    }
+    return CompareStringOrdinal(name, -1, g_control->targetFile, -1, TRUE) == CSTR_EQUAL;
+}
+
+// 判断本次调用是否注入故障，并消耗一次配额
+bool ShouldInject(LONG operation, HANDLE hFile) {
+    if (g_control == nullptr || g_control->armed == 0 || g_control->operation != operation || !IsTargetHandle(hFile)) {
+        return false;
+    }
+
+    for (;;) {
+        LONG remaining = g_control->remaining;
+        if (remaining == 0) {
+            return false;
+        }
+        LONG next = remaining < 0 ? remaining : remaining - 1;
+        if (InterlockedCompareExchange(&g_control->remaining, next, remaining) == remaining) {
+            InterlockedIncrement(&g_control->injected);
+            if (next == 0) {
+                InterlockedExchange(&g_control->armed, 0);
+            }
+            return true;
+        }
+    }
+}
+
+// 按故障注入计划执行写入
+BOOL InjectOrWrite(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite,
+                   LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped) {
+    if (!ShouldInject(SHIM_OP_WRITE, hFile)) {
+        return g_originalWriteFile(hFile, lpBuffer, nNumberOfBytesToWrite, lpNumberOfBytesWritten, lpOverlapped);
+    }
+
+    if (g_control->shortBytes != 0 && g_control->shortBytes < nNumberOfBytesToWrite) {
+        // 短写：只交给系统前 shortBytes 字节，调用方看到的是成功但字节数不足
+        return g_originalWriteFile(hFile, lpBuffer, g_control->shortBytes, lpNumberOfBytesWritten, lpOverlapped);
+    }
+
+    if (lpNumberOfBytesWritten != nullptr) {
+        *lpNumberOfBytesWritten = 0;
+    }
+    SetLastError(g_control->errorCode);
+    return FALSE;
+}
+
+BOOL WINAPI HookWriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite,
+                          LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped) {
+    std::wstring relative;
+    LARGE_INTEGER position = {};
+    bool record = false;
+    if (IsRecording() && RelativeFromHandle(hFile, relative)) {
+        if (lpOverlapped != nullptr) {
+            position.QuadPart = (static_cast<LONGLONG>(lpOverlapped->OffsetHigh) << 32) | lpOverlapped->Offset;
+            record = true;
+        } else {
+            LARGE_INTEGER zero = {};
+            record = SetFilePointerEx(hFile, zero, &position, FILE_CURRENT) != FALSE;
+        }
+    }
+
+    BOOL ok = InjectOrWrite(hFile, lpBuffer, nNumberOfBytesToWrite, lpNumberOfBytesWritten, lpOverlapped);
+    if (record && ok) {
+        DWORD length = lpNumberOfBytesWritten != nullptr && lpOverlapped == nullptr ? *lpNumberOfBytesWritten : nNumberOfBytesToWrite;
+        AppendTrace(L"write", relative, std::wstring(), true, position.QuadPart, length, SHIM_RETURN_ADDRESS());
+    }
+    return ok;
+}
+
+BOOL WINAPI HookFlushFileBuffers(HANDLE hFile) {
+    if (ShouldInject(SHIM_OP_FLUSH, hFile)) {
+        SetLastError(g_control->errorCode);
+        return FALSE;
+    }
+
+    BOOL ok = g_originalFlushFileBuffers(hFile);
+    std::wstring relative;
+    if (ok && IsRecording()) {
+        BY_HANDLE_FILE_INFORMATION info = {};
+        DWORD error = GetLastError();
+        bool isDirectory = GetFileInformationByHandle(hFile, &info) && (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        SetLastError(error);
+
+        if (RelativeFromHandle(hFile, relative)) {
+            AppendTrace(isDirectory ? L"dirsync" : L"fsync", relative, std::wstring(), false, 0, 0, SHIM_RETURN_ADDRESS());
+        } else if (isDirectory) {
+            // 被监控目录自身的刷盘记为 "."
+            WCHAR path[MAX_PATH * 2];
+            DWORD length = GetFinalPathNameByHandleW(hFile, path, MAX_PATH * 2, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+            SetLastError(error);
+            const WCHAR* start = length > 4 && wcsncmp(path, L"\\\\?\\", 4) == 0 ? path + 4 : path;
+            if (length != 0 && length < MAX_PATH * 2 &&
+                (lstrcmpiW(start, g_control->watchedFinalPath) == 0 || lstrcmpiW(start, g_control->watchedPath) == 0)) {
+                AppendTrace(L"dirsync", L".", std::wstring(), false, 0, 0, SHIM_RETURN_ADDRESS());
+            }
+        }
+    }
+    return ok;
+}
+
+HANDLE WINAPI HookCreateFileW(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode,
+                              LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition,
+                              DWORD dwFlagsAndAttributes, HANDLE hTemplateFile) {
+    std::wstring relative;
+    bool record = IsRecording() && RelativeFromName(lpFileName, relative);
+    bool existed = record && GetFileAttributesW(lpFileName) != INVALID_FILE_ATTRIBUTES;
+
+    HANDLE hFile = g_originalCreateFileW(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes,
+                                         dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+    if (record && hFile != INVALID_HANDLE_VALUE) {
+        if (!existed) {
+            AppendTrace(L"create", relative, std::wstring(), false, 0, 0, SHIM_RETURN_ADDRESS());
+        } else if (dwCreationDisposition == CREATE_ALWAYS || dwCreationDisposition == TRUNCATE_EXISTING) {
+            AppendTrace(L"truncate", relative, std::wstring(), false, 0, 0, SHIM_RETURN_ADDRESS());
+        }
+    }
+    return hFile;
+}
+
+// 改名：目录内改名记 rename，移出记 unlink，移入记 create
+void RecordMove(LPCWSTR from, LPCWSTR to, void* caller) {
+    std::wstring source;
+    std::wstring destination;
+    bool fromWatched = RelativeFromName(from, source);
+    bool toWatched = RelativeFromName(to, destination);
+    if (fromWatched && toWatched) {
+        AppendTrace(L"rename", source, destination, false, 0, 0, caller);
+    } else if (fromWatched) {
+        AppendTrace(L"unlink", source, std::wstring(), false, 0, 0, caller);
+    } else if (toWatched) {
+        AppendTrace(L"create", destination, std::wstring(), false, 0, 0, caller);
+    }
+}
+
+BOOL WINAPI HookMoveFileExW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileName, DWORD dwFlags) {
+    BOOL ok = g_originalMoveFileExW(lpExistingFileName, lpNewFileName, dwFlags);
+    if (ok && IsRecording()) {
+        RecordMove(lpExistingFileName, lpNewFileName, SHIM_RETURN_ADDRESS());
+    }
+    return ok;
+}
+
+BOOL WINAPI HookMoveFileW(LPCWSTR lpExistingFileName, LPCWSTR lpNewFileName) {
+    BOOL ok = g_originalMoveFileW(lpExistingFileName, lpNewFileName);
+    if (ok && IsRecording()) {
+        RecordMove(lpExistingFileName, lpNewFileName, SHIM_RETURN_ADDRESS());
+    }
+    return ok;
+}
+
+// 单路径命名空间操作的通用录制
+template <typename Original, typename... Args>
+BOOL RecordPathOperation(const WCHAR* op, LPCWSTR path, void* caller, Original original, Args... args) {
+    BOOL ok = original(path, args...);
+    std::wstring relative;
+    if (ok && IsRecording() && RelativeFromName(path, relative)) {
+        AppendTrace(op, relative, std::wstring(), false, 0, 0, caller);
+    }
+    return ok;
+}
+
+BOOL WINAPI HookDeleteFileW(LPCWSTR lpFileName) {
+    return RecordPathOperation(L"unlink", lpFileName, SHIM_RETURN_ADDRESS(), g_originalDeleteFileW);
+}
+
+BOOL WINAPI HookCreateDirectoryW(LPCWSTR lpPathName, LPSECURITY_ATTRIBUTES lpSecurityAttributes) {
+    return RecordPathOperation(L"mkdir", lpPathName, SHIM_RETURN_ADDRESS(), g_originalCreateDirectoryW, lpSecurityAttributes);
+}
+
+BOOL WINAPI HookRemoveDirectoryW(LPCWSTR lpPathName) {
+    return RecordPathOperation(L"rmdir", lpPathName, SHIM_RETURN_ADDRESS(), g_originalRemoveDirectoryW);
+}
+
+struct HookEntry {
+    const char* name;
+    void* hook;
+};
+
+// 修改一个模块导入表中按名称导入的函数
+void PatchModuleImports(HMODULE module, const HookEntry* hooks, size_t hookCount) {
+    auto* base = reinterpret_cast<BYTE*>(module);
+    auto* dos = reinterpret_cast<IMAGE_DOS_HEADER*>(base);
+    auto* nt = reinterpret_cast<IMAGE_NT_HEADERS*>(base + dos->e_lfanew);
+    const IMAGE_DATA_DIRECTORY& directory = nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (directory.VirtualAddress == 0) {
+        return;
+    }
+
+    auto* descriptor = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*>(base + directory.VirtualAddress);
+    for (; descriptor->Name != 0; ++descriptor) {
+        if (descriptor->OriginalFirstThunk == 0) {
+            continue; // 没有名称表，无法按名称匹配
+        }
+
+        auto* nameThunk = reinterpret_cast<IMAGE_THUNK_DATA*>(base + descriptor->OriginalFirstThunk);
+        auto* addressThunk = reinterpret_cast<IMAGE_THUNK_DATA*>(base + descriptor->FirstThunk);
+        for (; nameThunk->u1.AddressOfData != 0; ++nameThunk, ++addressThunk) {
+            if (IMAGE_SNAP_BY_ORDINAL(nameThunk->u1.Ordinal)) {
+                continue;
+            }
+
+            auto* import = reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(base + nameThunk->u1.AddressOfData);
+            for (size_t i = 0; i < hookCount; ++i) {
+                if (lstrcmpA(import->Name, hooks[i].name) != 0) {
+                    continue;
+                }
+                DWORD oldProtect = 0;
+                if (VirtualProtect(&addressThunk->u1.Function, sizeof(addressThunk->u1.Function), PAGE_READWRITE, &oldProtect)) {
+                    addressThunk->u1.Function = reinterpret_cast<ULONG_PTR>(hooks[i].hook);
+                    VirtualProtect(&addressThunk->u1.Function, sizeof(addressThunk->u1.Function), oldProtect, &oldProtect);
+                }
+            }
+        }
+    }
+}
+
+// 遍历进程内已加载模块（跳过本库），安装全部钩子
+void InstallHooks(HMODULE self, const HookEntry* hooks, size_t hookCount) {
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    MODULEENTRY32W entry = {};
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Module32FirstW(snapshot, &entry); more; more = Module32NextW(snapshot, &entry)) {
+        if (entry.hModule != self) {
+            PatchModuleImports(entry.hModule, hooks, hookCount);
+        }
+    }
+    CloseHandle(snapshot);
+}
+
+bool Attach() {
+    WCHAR name[64];
+    FormatShimControlName(GetCurrentProcessId(), name, 64);
+    g_mapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, name);
+    if (g_mapping == nullptr) {
+        return false; // 不是由 FileDetection 启动的进程，保持不变
+    }
+
+    g_control = static_cast<ShimControlBlock*>(MapViewOfFile(g_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShimControlBlock)));
+    if (g_control == nullptr || g_control->version != FILE_DETECTION_SHIM_VERSION) {
+        return false;
+    }
+
+    HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+    g_originalWriteFile = reinterpret_cast<WriteFileFunc>(GetProcAddress(kernel32, "WriteFile"));
+    g_originalFlushFileBuffers = reinterpret_cast<FlushFileBuffersFunc>(GetProcAddress(kernel32, "FlushFileBuffers"));
+    g_originalCreateFileW = reinterpret_cast<CreateFileWFunc>(GetProcAddress(kernel32, "CreateFileW"));
+    g_originalMoveFileExW = reinterpret_cast<MoveFileExWFunc>(GetProcAddress(kernel32, "MoveFileExW"));
+    g_originalMoveFileW = reinterpret_cast<MoveFileWFunc>(GetProcAddress(kernel32, "MoveFileW"));
+    g_originalDeleteFileW = reinterpret_cast<DeleteFileWFunc>(GetProcAddress(kernel32, "DeleteFileW"));
+    g_originalCreateDirectoryW = reinterpret_cast<CreateDirectoryWFunc>(GetProcAddress(kernel32, "CreateDirectoryW"));
+    g_originalRemoveDirectoryW = reinterpret_cast<RemoveDirectoryWFunc>(GetProcAddress(kernel32, "RemoveDirectoryW"));
+
+    bool inputs = g_control->inputMode != SHIM_INPUT_OFF;
+    if (g_control->timeScale > 1 || inputs) {
+        g_originalQueryPerformanceCounter = reinterpret_cast<QueryPerformanceCounterFunc>(GetProcAddress(kernel32, "QueryPerformanceCounter"));
+        g_originalGetTickCount64 = reinterpret_cast<GetTickCount64Func>(GetProcAddress(kernel32, "GetTickCount64"));
+        g_originalGetSystemTimeAsFileTime = reinterpret_cast<GetSystemTimeAsFileTimeFunc>(GetProcAddress(kernel32, "GetSystemTimeAsFileTime"));
+        g_originalGetSystemTimePreciseAsFileTime = reinterpret_cast<GetSystemTimeAsFileTimeFunc>(GetProcAddress(kernel32, "GetSystemTimePreciseAsFileTime"));
+    }
+    if (g_control->timeScale > 1) {
+        g_originalSleep = reinterpret_cast<SleepFunc>(GetProcAddress(kernel32, "Sleep"));
+        g_originalSleepEx = reinterpret_cast<SleepExFunc>(GetProcAddress(kernel32, "SleepEx"));
+        g_originalWaitForSingleObjectEx = reinterpret_cast<WaitForSingleObjectExFunc>(GetProcAddress(kernel32, "WaitForSingleObjectEx"));
+        g_originalWaitForMultipleObjectsEx = reinterpret_cast<WaitForMultipleObjectsExFunc>(GetProcAddress(kernel32, "WaitForMultipleObjectsEx"));
+        g_originalSetWaitableTimer = reinterpret_cast<SetWaitableTimerFunc>(GetProcAddress(kernel32, "SetWaitableTimer"));
+        g_originalCreateTimerQueueTimer = reinterpret_cast<CreateTimerQueueTimerFunc>(GetProcAddress(kernel32, "CreateTimerQueueTimer"));
+        g_originalSetThreadpoolTimer = reinterpret_cast<SetThreadpoolTimerFunc>(GetProcAddress(kernel32, "SetThreadpoolTimer"));
+        // user32 只在写文件程序已加载时拦截（未加载的模块不会被修改导入表）
+        HMODULE user32 = GetModuleHandleW(L"user32.dll");
+        if (user32 != nullptr) {
+            g_originalMsgWaitForMultipleObjectsEx = reinterpret_cast<MsgWaitForMultipleObjectsExFunc>(GetProcAddress(user32, "MsgWaitForMultipleObjectsEx"));
+            g_originalSetTimer = reinterpret_cast<SetTimerFunc>(GetProcAddress(user32, "SetTimer"));
+        }
+    }
+
+    if (inputs) {
+        g_originalReadFile = reinterpret_cast<ReadFileFunc>(GetProcAddress(kernel32, "ReadFile"));
+        // 套接字与随机数来源同样只在已加载时拦截
+        HMODULE ws2_32 = GetModuleHandleW(L"ws2_32.dll");
+        if (ws2_32 != nullptr) {
+            g_originalConnect = reinterpret_cast<ConnectFunc>(GetProcAddress(ws2_32, "connect"));
+            g_originalRecv = reinterpret_cast<RecvFunc>(GetProcAddress(ws2_32, "recv"));
+            g_originalSend = reinterpret_cast<SendFunc>(GetProcAddress(ws2_32, "send"));
+        }
+        HMODULE bcrypt = GetModuleHandleW(L"bcrypt.dll");
+        if (bcrypt != nullptr) {
+            g_originalBCryptGenRandom = reinterpret_cast<BCryptGenRandomFunc>(GetProcAddress(bcrypt, "BCryptGenRandom"));
+        }
+        HMODULE advapi32 = GetModuleHandleW(L"advapi32.dll");
+        if (advapi32 != nullptr) {
+            g_originalRtlGenRandom = reinterpret_cast<RtlGenRandomFunc>(GetProcAddress(advapi32, "SystemFunction036"));
+            g_originalCryptGenRandom = reinterpret_cast<CryptGenRandomFunc>(GetProcAddress(advapi32, "CryptGenRandom"));
+        }
+
+        InitializeCriticalSection(&g_inputLock);
+        if (g_control->inputMode == SHIM_INPUT_CAPTURE) {
+            g_inputLog = CreateFileW(g_control->inputFile, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+                                     FILE_ATTRIBUTE_NORMAL, nullptr);
+        } else if (!LoadInputLog(g_control->inputFile)) {
+            return false; // 回放缺少录制时不能退化为真实输入
+        }
+    }
+
+    if (g_control->recording != 0) {
+        InitializeCriticalSection(&g_traceLock);
+        g_trace = CreateFileW(g_control->traceFile, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+
+    const HookEntry hooks[] = {
+        { "WriteFile", reinterpret_cast<void*>(&HookWriteFile) },
+        { "FlushFileBuffers", reinterpret_cast<void*>(&HookFlushFileBuffers) },
+        { "CreateFileW", reinterpret_cast<void*>(&HookCreateFileW) },
+        { "MoveFileExW", reinterpret_cast<void*>(&HookMoveFileExW) },
+        { "MoveFileW", reinterpret_cast<void*>(&HookMoveFileW) },
+        { "DeleteFileW", reinterpret_cast<void*>(&HookDeleteFileW) },
+        { "CreateDirectoryW", reinterpret_cast<void*>(&HookCreateDirectoryW) },
+        { "RemoveDirectoryW", reinterpret_cast<void*>(&HookRemoveDirectoryW) },
+    };
+    InstallHooks(g_self, hooks, sizeof(hooks) / sizeof(hooks[0]));
+
+    // 时间膨胀与输入录制/回放钩子：原函数未解析（未开启或模块未加载）的条目跳过
+    const struct {
+        HookEntry entry;
+        const void* original;
+    } optionalHooks[] = {
+        { { "QueryPerformanceCounter", reinterpret_cast<void*>(&HookQueryPerformanceCounter) }, reinterpret_cast<const void*>(g_originalQueryPerformanceCounter) },
+        { { "GetTickCount64", reinterpret_cast<void*>(&HookGetTickCount64) }, reinterpret_cast<const void*>(g_originalGetTickCount64) },
+        { { "GetTickCount", reinterpret_cast<void*>(&HookGetTickCount) }, reinterpret_cast<const void*>(g_originalGetTickCount64) },
+        { { "GetSystemTimeAsFileTime", reinterpret_cast<void*>(&HookGetSystemTimeAsFileTime) }, reinterpret_cast<const void*>(g_originalGetSystemTimeAsFileTime) },
+        { { "GetSystemTimePreciseAsFileTime", reinterpret_cast<void*>(&HookGetSystemTimePreciseAsFileTime) }, reinterpret_cast<const void*>(g_originalGetSystemTimePreciseAsFileTime) },
+        { { "Sleep", reinterpret_cast<void*>(&HookSleep) }, reinterpret_cast<const void*>(g_originalSleep) },
+        { { "SleepEx", reinterpret_cast<void*>(&HookSleepEx) }, reinterpret_cast<const void*>(g_originalSleepEx) },
+        { { "WaitForSingleObject", reinterpret_cast<void*>(&HookWaitForSingleObject) }, reinterpret_cast<const void*>(g_originalWaitForSingleObjectEx) },
+        { { "WaitForSingleObjectEx", reinterpret_cast<void*>(&HookWaitForSingleObjectEx) }, reinterpret_cast<const void*>(g_originalWaitForSingleObjectEx) },
+        { { "WaitForMultipleObjects", reinterpret_cast<void*>(&HookWaitForMultipleObjects) }, reinterpret_cast<const void*>(g_originalWaitForMultipleObjectsEx) },
+        { { "WaitForMultipleObjectsEx", reinterpret_cast<void*>(&HookWaitForMultipleObjectsEx) }, reinterpret_cast<const void*>(g_originalWaitForMultipleObjectsEx) },
+        { { "MsgWaitForMultipleObjects", reinterpret_cast<void*>(&HookMsgWaitForMultipleObjects) }, reinterpret_cast<const void*>(g_originalMsgWaitForMultipleObjectsEx) },
+        { { "MsgWaitForMultipleObjectsEx", reinterpret_cast<void*>(&HookMsgWaitForMultipleObjectsEx) }, reinterpret_cast<const void*>(g_originalMsgWaitForMultipleObjectsEx) },
+        { { "SetTimer", reinterpret_cast<void*>(&HookSetTimer) }, reinterpret_cast<const void*>(g_originalSetTimer) },
+        { { "SetWaitableTimer", reinterpret_cast<void*>(&HookSetWaitableTimer) }, reinterpret_cast<const void*>(g_originalSetWaitableTimer) },
+        { { "CreateTimerQueueTimer", reinterpret_cast<void*>(&HookCreateTimerQueueTimer) }, reinterpret_cast<const void*>(g_originalCreateTimerQueueTimer) },
+        { { "SetThreadpoolTimer", reinterpret_cast<void*>(&HookSetThreadpoolTimer) }, reinterpret_cast<const void*>(g_originalSetThreadpoolTimer) },
+        { { "ReadFile", reinterpret_cast<void*>(&HookReadFile) }, reinterpret_cast<const void*>(g_originalReadFile) },
+        { { "connect", reinterpret_cast<void*>(&HookConnect) }, reinterpret_cast<const void*>(g_originalConnect) },
+        { { "recv", reinterpret_cast<void*>(&HookRecv) }, reinterpret_cast<const void*>(g_originalRecv) },
+        { { "send", reinterpret_cast<void*>(&HookSend) }, reinterpret_cast<const void*>(g_originalSend) },
+        { { "BCryptGenRandom", reinterpret_cast<void*>(&HookBCryptGenRandom) }, reinterpret_cast<const void*>(g_originalBCryptGenRandom) },
+        { { "SystemFunction036", reinterpret_cast<void*>(&HookRtlGenRandom) }, reinterpret_cast<const void*>(g_originalRtlGenRandom) },
+        { { "CryptGenRandom", reinterpret_cast<void*>(&HookCryptGenRandom) }, reinterpret_cast<const void*>(g_originalCryptGenRandom) },
+    };
+    HookEntry resolved[sizeof(optionalHooks) / sizeof(optionalHooks[0])];
+    size_t resolvedCount = 0;
+    for (const auto& hook : optionalHooks) {
+        if (hook.original != nullptr) {
+            resolved[resolvedCount++] = hook.entry;
+        }
+    }
+    if (resolvedCount > 0) {
+        InstallHooks(g_self, resolved, resolvedCount);
+    }
+    InterlockedExchange(&g_control->attached, 1);
+    return true;
+}
+
+} // namespace
+
+// 远程线程入口：成功安装钩子返回 1
+extern "C" __declspec(dllexport) DWORD WINAPI FileDetectionShimAttach(LPVOID) {
+    return Attach() ? 1 : 0;
+}
+
+BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID) {
+    if (reason == DLL_PROCESS_ATTACH) {
+        g_self = hInstance;
+        DisableThreadLibraryCalls(hInstance);
+    }
+    return TRUE;
+}